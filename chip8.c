@@ -56,7 +56,7 @@ void clear_chip8(Chip8* chip8)
 {
     memset(chip8->memory, 0, SIZE_MEMORY);
     memset(chip8->display, 0, SIZE_DISPLAY);
-    memset(chip8->stack, 0, SIZE_STACK);
+    memset(chip8->stack, 0, sizeof(chip8->stack));
     memset(chip8->v, 0, SIZE_V);
 
     chip8->i = 0;
@@ -70,10 +70,63 @@ void clear_chip8(Chip8* chip8)
     chip8->keys = 0;
     chip8->vblank = 0;
 
+    chip8->rng = (uint32_t)rand() | 1;
+    chip8->frame = 0;
+
+    chip8->event_head = 0;
+    chip8->event_tail = 0;
+    memset(chip8->event_counts, 0, sizeof(chip8->event_counts));
+    chip8->events_dropped = 0;
+
+    // Breakpoints and watchpoints are kept across loads
+    if (chip8->debug != NULL) {
+        chip8->debug->resume = HLT_NONE;
+    }
+
     // Load font data
     memcpy(chip8->memory, FONT_DATA, sizeof(FONT_DATA));
 }
 
+void push_event(Chip8* chip8, EventCode code, uint16_t opcode)
+{
+    uint16_t pc = chip8->pc - 2;
+    chip8->event_counts[code]++;
+
+    // Merge with an identical pending event, so that loops only produce one event per location and drain
+    for (uint32_t i = chip8->event_head; i != chip8->event_tail; i++) {
+        Chip8Event* pending = &chip8->events[i % SIZE_EVENTS];
+        if (pending->code == code && pending->pc == pc && pending->opcode == opcode) {
+            pending->repeat++;
+            return;
+        }
+    }
+
+    if (chip8->event_tail - chip8->event_head == SIZE_EVENTS) {
+        chip8->events_dropped++;
+        return;
+    }
+
+    Chip8Event* event = &chip8->events[chip8->event_tail % SIZE_EVENTS];
+    event->code = code;
+    event->pc = pc;
+    event->opcode = opcode;
+    event->frame = chip8->frame;
+    event->repeat = 0;
+    chip8->event_tail++;
+}
+
+uint8_t next_random(Chip8* chip8)
+{
+    // xorshift32, kept per instance so that runs are reproducible from a given state
+    uint32_t x = chip8->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->rng = x;
+
+    return x >> 24;
+}
+
 void op_0x0NNN(Chip8* chip8, uint16_t opcode)
 {
     switch (opcode & 0x00FF) {
@@ -82,7 +135,7 @@ void op_0x0NNN(Chip8* chip8, uint16_t opcode)
         break;
     case 0xEE: // Instr 0x00EE: Return from subroutine
         if (chip8->sp == 0) {
-            fprintf(stderr, "Stack underflow\n");
+            push_event(chip8, EVT_STACK_UNDERFLOW, opcode);
             chip8->halt_code = HLT_STACK_UNDERFLOW;
             return;
         }
@@ -91,7 +144,7 @@ void op_0x0NNN(Chip8* chip8, uint16_t opcode)
         break;
     default: // Instr 0x0NNN: Execute machine language subroutine at address NNN
              // Ignore this instruction
-        fprintf(stderr, "Opcode 0x0NNN ignored\n");
+        push_event(chip8, EVT_OPCODE_IGNORED, opcode);
         break;
     }
 }
@@ -100,7 +153,7 @@ void op_0x2000(Chip8* chip8, uint16_t opcode)
 {
     uint16_t nnn = opcode & 0x0FFF;
     if (chip8->sp == SIZE_STACK) {
-        fprintf(stderr, "Stack overflow\n");
+        push_event(chip8, EVT_STACK_OVERFLOW, opcode);
         chip8->halt_code = HLT_STACK_OVERFLOW;
         return;
     }
@@ -157,7 +210,7 @@ void op_0x8XYN(Chip8* chip8, uint16_t opcode)
         chip8->v[0xF] = tmp;
     } break;
     default:
-        fprintf(stderr, "Unknown opcode: 0x%X\n", opcode);
+        push_event(chip8, EVT_UNKNOWN_INSTRUCTION, opcode);
         chip8->halt_code = HLT_UNKNOWN_INSTRUCTION;
         return;
     }
@@ -218,7 +271,7 @@ void op_0xEXNN(Chip8* chip8, uint16_t opcode)
         }
         break;
     default:
-        fprintf(stderr, "Unknown opcode: 0x%X\n", opcode);
+        push_event(chip8, EVT_UNKNOWN_INSTRUCTION, opcode);
         chip8->halt_code = HLT_UNKNOWN_INSTRUCTION;
         return;
     }
@@ -277,12 +330,140 @@ void op_0xFXNN(Chip8* chip8, uint16_t opcode)
         chip8->i += x + 1;
         break;
     default:
-        fprintf(stderr, "Unknown opcode: 0x%X\n", opcode);
+        push_event(chip8, EVT_UNKNOWN_INSTRUCTION, opcode);
         chip8->halt_code = HLT_UNKNOWN_INSTRUCTION;
         return;
     }
 }
 
+int debug_test(const uint8_t* bitmap, uint16_t address)
+{
+    return (bitmap[address / 8] >> (address % 8)) & 1;
+}
+
+// Whether the instruction only waits for vblank or a key and will be executed again
+int debug_instruction_waits(Chip8* chip8, uint16_t opcode)
+{
+    if ((opcode & 0xF000) == 0xD000) {
+        return chip8->vblank == 0;
+    }
+    if ((opcode & 0xF0FF) == 0xF00A) {
+        return chip8->keys == 0;
+    }
+    return 0;
+}
+
+int debug_check_access(Chip8* chip8, const uint8_t* bitmap, WatchMode mode, uint16_t address, uint16_t size)
+{
+    Chip8Debug* debug = chip8->debug;
+    for (uint32_t a = address; a < (uint32_t)address + size && a < SIZE_MEMORY; a++) {
+        if ((debug->watch_pages >> (a / 256)) & 1 && debug_test(bitmap, a)) {
+            debug->hit_address = a;
+            debug->hit_mode = mode;
+            chip8->halt_code = HLT_WATCHPOINT;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Slow path of chip8_next_instruction, only taken while a breakpoint or watchpoint is set
+// Returns 1 if the instruction must not be executed
+int debug_check(Chip8* chip8)
+{
+    Chip8Debug* debug = chip8->debug;
+    HaltCode resume = debug->resume;
+    debug->resume = HLT_NONE;
+
+    // Watchpoints are checked after breakpoints, nothing is left to check
+    if (resume == HLT_WATCHPOINT) {
+        return 0;
+    }
+
+    if (chip8->pc > SIZE_MEMORY - 2) {
+        return 0;
+    }
+
+    uint16_t opcode = chip8_current_instruction(chip8);
+    if (debug_instruction_waits(chip8, opcode)) {
+        return 0;
+    }
+
+    if (resume != HLT_BREAKPOINT && debug_test(debug->breakpoints, chip8->pc)) {
+        debug->hit_address = chip8->pc;
+        chip8->halt_code = HLT_BREAKPOINT;
+        return 1;
+    }
+
+    if (debug->watch_pages == 0) {
+        return 0;
+    }
+
+    uint8_t x = (opcode & 0x0F00) >> 8;
+    switch (opcode & 0xF000) {
+    case 0xD000: { // Sprite data, op_0xDXYN stops reading after the row past the bottom of the display
+        uint8_t y = (opcode & 0x00F0) >> 4;
+        uint16_t rows = DISPLAY_HEIGHT - (chip8->v[y] % DISPLAY_HEIGHT) + 1;
+        uint16_t count = opcode & 0x000F;
+        return debug_check_access(chip8, debug->watch_read, WATCH_READ, chip8->i, count < rows ? count : rows);
+    }
+    case 0xF000:
+        switch (opcode & 0x00FF) {
+        case 0x29: // Font data
+            return debug_check_access(chip8, debug->watch_read, WATCH_READ, chip8->v[x] * 5, 1);
+        case 0x33:
+            return debug_check_access(chip8, debug->watch_write, WATCH_WRITE, chip8->i, 3);
+        case 0x55:
+            return debug_check_access(chip8, debug->watch_write, WATCH_WRITE, chip8->i, x + 1);
+        case 0x65:
+            return debug_check_access(chip8, debug->watch_read, WATCH_READ, chip8->i, x + 1);
+        }
+    }
+
+    return 0;
+}
+
+// Pages are rebuilt from the bitmaps, since clearing a range may leave other watchpoints in a page
+void debug_update_pages(Chip8Debug* debug)
+{
+    debug->watch_pages = 0;
+    for (int a = 0; a < SIZE_MEMORY; a += 8) {
+        if (debug->watch_read[a / 8] != 0 || debug->watch_write[a / 8] != 0) {
+            debug->watch_pages |= 1 << (a / 256);
+        }
+    }
+}
+
+Chip8Debug* debug_get(Chip8* chip8)
+{
+    if (chip8->debug == NULL) {
+        chip8->debug = calloc(1, sizeof(Chip8Debug));
+    }
+    return chip8->debug;
+}
+
+// Free the debug state once empty so that chip8_next_instruction is back on its fast path
+void debug_release_if_empty(Chip8* chip8)
+{
+    Chip8Debug* debug = chip8->debug;
+    if (debug == NULL || debug->watch_pages != 0) {
+        return;
+    }
+
+    // Keep the hit information until the instance is resumed
+    if (chip8->halt_code == HLT_BREAKPOINT || chip8->halt_code == HLT_WATCHPOINT) {
+        return;
+    }
+
+    for (int i = 0; i < SIZE_MEMORY / 8; i++) {
+        if (debug->breakpoints[i] != 0) {
+            return;
+        }
+    }
+
+    chip8_clear_debug(chip8);
+}
+
 /* Basic functions */
 Chip8* chip8_new()
 {
@@ -291,6 +472,7 @@ Chip8* chip8_new()
         return NULL;
     }
 
+    chip8->debug = NULL;
     clear_chip8(chip8);
 
     return chip8;
@@ -298,6 +480,11 @@ Chip8* chip8_new()
 
 void chip8_free(Chip8** chip8)
 {
+    if (*chip8 == NULL) {
+        return;
+    }
+
+    free((*chip8)->debug);
     free(*chip8);
     *chip8 = NULL;
 }
@@ -337,6 +524,10 @@ uint8_t chip8_get_pixel(Chip8* chip8, int x, int y)
 
 void chip8_next_instruction(Chip8* chip8)
 {
+    if (chip8->debug != NULL && debug_check(chip8)) {
+        return;
+    }
+
     uint16_t opcode = chip8->memory[chip8->pc] << 8 | chip8->memory[chip8->pc + 1];
     chip8->pc += 2;
 
@@ -390,7 +581,7 @@ void chip8_next_instruction(Chip8* chip8)
         chip8->pc = nnn + chip8->v[0];
         break;
     case 0xC000: // Instr 0xCXNN: Set VX to a random number AND NN
-        chip8->v[x] = rand() & nn;
+        chip8->v[x] = next_random(chip8) & nn;
         break;
     case 0xD000: // Instr 0xDXYN: Draw a sprite at position VX, VY with N bytes of sprite data starting at the address stored in I
                  // Set VF to 0x01 if any set pixels are changed to unset, else 0x00
@@ -412,6 +603,7 @@ uint16_t chip8_current_instruction(Chip8* chip8)
 void chip8_vblank(Chip8* chip8)
 {
     chip8->vblank = 1;
+    chip8->frame++;
 
     if (chip8->timer_delay > 0) {
         chip8->timer_delay--;
@@ -431,3 +623,134 @@ void chip8_key_up(Chip8* chip8, uint8_t key)
 {
     chip8->keys &= ~(1 << (key & 0xF));
 }
+
+int chip8_poll_event(Chip8* chip8, Chip8Event* event)
+{
+    if (chip8->event_head == chip8->event_tail) {
+        return 0;
+    }
+
+    *event = chip8->events[chip8->event_head % SIZE_EVENTS];
+    chip8->event_head++;
+
+    return 1;
+}
+
+// Returns the number of events dropped since the last call
+uint32_t chip8_take_dropped_events(Chip8* chip8)
+{
+    uint32_t dropped = chip8->events_dropped;
+    chip8->events_dropped = 0;
+
+    return dropped;
+}
+
+const char* chip8_event_name(EventCode code)
+{
+    switch (code) {
+    case EVT_OPCODE_IGNORED:
+        return "Opcode 0x0NNN ignored";
+    case EVT_UNKNOWN_INSTRUCTION:
+        return "Unknown opcode";
+    case EVT_STACK_OVERFLOW:
+        return "Stack overflow";
+    case EVT_STACK_UNDERFLOW:
+        return "Stack underflow";
+    default:
+        return "Unknown event";
+    }
+}
+
+/* Debug functions */
+int chip8_set_breakpoint(Chip8* chip8, uint16_t address)
+{
+    if (address >= SIZE_MEMORY) {
+        return 1;
+    }
+
+    Chip8Debug* debug = debug_get(chip8);
+    if (debug == NULL) {
+        return 2;
+    }
+
+    debug->breakpoints[address / 8] |= 1 << (address % 8);
+
+    return 0;
+}
+
+void chip8_clear_breakpoint(Chip8* chip8, uint16_t address)
+{
+    if (chip8->debug == NULL || address >= SIZE_MEMORY) {
+        return;
+    }
+
+    chip8->debug->breakpoints[address / 8] &= ~(1 << (address % 8));
+    debug_release_if_empty(chip8);
+}
+
+int chip8_set_watchpoint(Chip8* chip8, uint16_t address, uint16_t size, int mode)
+{
+    if ((mode & (WATCH_READ | WATCH_WRITE)) == 0 || size == 0 || (uint32_t)address + size > SIZE_MEMORY) {
+        return 1;
+    }
+
+    Chip8Debug* debug = debug_get(chip8);
+    if (debug == NULL) {
+        return 2;
+    }
+
+    for (uint32_t a = address; a < (uint32_t)address + size; a++) {
+        if (mode & WATCH_READ) {
+            debug->watch_read[a / 8] |= 1 << (a % 8);
+        }
+        if (mode & WATCH_WRITE) {
+            debug->watch_write[a / 8] |= 1 << (a % 8);
+        }
+    }
+
+    debug_update_pages(debug);
+
+    return 0;
+}
+
+void chip8_clear_watchpoint(Chip8* chip8, uint16_t address, uint16_t size, int mode)
+{
+    Chip8Debug* debug = chip8->debug;
+    if (debug == NULL) {
+        return;
+    }
+
+    for (uint32_t a = address; a < (uint32_t)address + size && a < SIZE_MEMORY; a++) {
+        if (mode & WATCH_READ) {
+            debug->watch_read[a / 8] &= ~(1 << (a % 8));
+        }
+        if (mode & WATCH_WRITE) {
+            debug->watch_write[a / 8] &= ~(1 << (a % 8));
+        }
+    }
+
+    debug_update_pages(debug);
+
+    debug_release_if_empty(chip8);
+}
+
+void chip8_clear_debug(Chip8* chip8)
+{
+    free(chip8->debug);
+    chip8->debug = NULL;
+}
+
+void chip8_resume(Chip8* chip8)
+{
+    if (chip8->halt_code != HLT_BREAKPOINT && chip8->halt_code != HLT_WATCHPOINT) {
+        return;
+    }
+
+    if (chip8->debug != NULL) {
+        chip8->debug->resume = chip8->halt_code;
+    }
+    chip8->halt_code = HLT_NONE;
+
+    // Breakpoints and watchpoints cleared while halted are released now
+    debug_release_if_empty(chip8);
+}
@@ -32,6 +32,9 @@
 #define SIZE_DISPLAY 256
 #define SIZE_STACK 16
 #define SIZE_V 16
+#define SIZE_EVENTS 64
+
+_Static_assert((SIZE_EVENTS & (SIZE_EVENTS - 1)) == 0, "SIZE_EVENTS must be a power of two");
 
 #define DISPLAY_WIDTH 64
 #define DISPLAY_HEIGHT 32
@@ -41,9 +44,43 @@ typedef enum {
     HLT_UNKNOWN_INSTRUCTION,
     HLT_STACK_OVERFLOW,
     HLT_STACK_UNDERFLOW,
+    HLT_BREAKPOINT,
+    HLT_WATCHPOINT,
     HLT_NOT_IMPLEMENTED = 0xFF,
 } HaltCode;
 
+typedef enum {
+    EVT_OPCODE_IGNORED = 0,
+    EVT_UNKNOWN_INSTRUCTION,
+    EVT_STACK_OVERFLOW,
+    EVT_STACK_UNDERFLOW,
+    EVT_COUNT,
+} EventCode;
+
+typedef struct {
+    EventCode code;
+    uint16_t pc; // Address of the instruction that raised the event
+    uint16_t opcode;
+    uint32_t frame;
+    uint32_t repeat; // Number of identical events merged into this one
+} Chip8Event;
+
+typedef enum {
+    WATCH_READ = 1,
+    WATCH_WRITE = 2,
+} WatchMode;
+
+typedef struct {
+    uint8_t breakpoints[SIZE_MEMORY / 8];
+    uint8_t watch_read[SIZE_MEMORY / 8];
+    uint8_t watch_write[SIZE_MEMORY / 8];
+    uint16_t watch_pages; // One bit per 256 bytes page containing a watchpoint
+
+    uint16_t hit_address; // Address of the last breakpoint or watchpoint hit
+    WatchMode hit_mode;   // Access of the last watchpoint hit
+    HaltCode resume;      // Check that stopped the next instruction, skipped when it is executed
+} Chip8Debug;
+
 typedef struct {
     uint8_t memory[SIZE_MEMORY];
     uint8_t display[SIZE_DISPLAY];
@@ -60,6 +97,18 @@ typedef struct {
     uint16_t keys;
     HaltCode halt_code;
     uint8_t vblank;
+
+    uint32_t rng; // Random generator state used by CXNN, never 0
+    uint32_t frame; // Number of vblanks since load
+
+    // Diagnostic events, drained by the frontend with chip8_poll_event
+    Chip8Event events[SIZE_EVENTS];
+    uint32_t event_head;
+    uint32_t event_tail;
+    uint32_t event_counts[EVT_COUNT]; // Total per code, including merged and dropped events
+    uint32_t events_dropped;
+
+    Chip8Debug* debug; // NULL when no breakpoint or watchpoint is set
 } Chip8;
 
 /* Basic functions */
@@ -76,4 +125,16 @@ void chip8_vblank(Chip8* chip8);
 void chip8_key_down(Chip8* chip8, uint8_t key);
 void chip8_key_up(Chip8* chip8, uint8_t key);
 
+int chip8_poll_event(Chip8* chip8, Chip8Event* event);
+uint32_t chip8_take_dropped_events(Chip8* chip8);
+const char* chip8_event_name(EventCode code);
+
+/* Debug functions */
+int chip8_set_breakpoint(Chip8* chip8, uint16_t address);
+void chip8_clear_breakpoint(Chip8* chip8, uint16_t address);
+int chip8_set_watchpoint(Chip8* chip8, uint16_t address, uint16_t size, int mode);
+void chip8_clear_watchpoint(Chip8* chip8, uint16_t address, uint16_t size, int mode);
+void chip8_clear_debug(Chip8* chip8);
+void chip8_resume(Chip8* chip8);
+
 #endif // CHIP8_H
@@ -0,0 +1,293 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Alys Elica
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "framestream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+
+#define STDOUT_FILENO 1
+
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+
+// Windows has no writev, write the buffers one by one
+static long writev(int fd, const struct iovec* iov, int iovcnt)
+{
+    long total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        int written = _write(fd, iov[i].iov_base, (unsigned int)iov[i].iov_len);
+        if (written < 0) {
+            return total > 0 ? total : -1;
+        }
+        total += written;
+        if ((size_t)written < iov[i].iov_len) {
+            break;
+        }
+    }
+    return total;
+}
+#else
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define FRAMESTREAM_IOV_MAX IOV_MAX
+#else
+#define FRAMESTREAM_IOV_MAX 1024
+#endif
+
+#define STREAM_HEADER_SIZE 8
+#define FRAME_HEADER_SIZE 7
+
+struct FrameStream {
+    int fd;
+    int owns_fd;
+
+    uint8_t stream_header[STREAM_HEADER_SIZE];
+    int stream_header_pending;
+
+    uint8_t previous[SIZE_DISPLAY];
+    int has_previous;
+    uint32_t last_keyframe;
+
+    // Pending records, flushed with a single writev call
+    int count;
+    uint32_t pending_frame; // Frame of the oldest pending record
+    uint8_t headers[FRAMESTREAM_BATCH][FRAME_HEADER_SIZE];
+    uint8_t payloads[FRAMESTREAM_BATCH][SIZE_DISPLAY];
+    uint16_t lengths[FRAMESTREAM_BATCH];
+    struct iovec iov[FRAMESTREAM_BATCH * 2 + 1];
+};
+
+/* Private functions */
+// Returns the encoded length, 0 if both frames are identical, -1 if the delta is not smaller than a raw frame
+int encode_delta(const uint8_t* previous, const uint8_t* display, uint8_t* out)
+{
+    int length = 0;
+    int pos = 0;
+    while (pos < SIZE_DISPLAY) {
+        int skip = 0;
+        while (pos < SIZE_DISPLAY && skip < 0xFF && previous[pos] == display[pos]) {
+            pos++;
+            skip++;
+        }
+        if (pos == SIZE_DISPLAY) {
+            break; // Trailing unchanged bytes are implicit
+        }
+
+        int count = 0;
+        while (pos + count < SIZE_DISPLAY && count < 0xFF && previous[pos + count] != display[pos + count]) {
+            count++;
+        }
+
+        if (length + 2 + count >= SIZE_DISPLAY) {
+            return -1;
+        }
+
+        out[length++] = skip;
+        out[length++] = count;
+        for (int i = 0; i < count; i++) {
+            out[length++] = previous[pos + i] ^ display[pos + i];
+        }
+        pos += count;
+    }
+
+    return length;
+}
+
+int write_all(int fd, struct iovec* iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        int batch = iovcnt < FRAMESTREAM_IOV_MAX ? iovcnt : FRAMESTREAM_IOV_MAX;
+        long written = writev(fd, iov, batch);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+
+        // Skip fully written buffers, then adjust the partially written one
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+/* Basic functions */
+FrameStream* framestream_open(const char* path)
+{
+    FrameStream* stream = malloc(sizeof(FrameStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    if (strcmp(path, "-") == 0) {
+        stream->fd = STDOUT_FILENO;
+        stream->owns_fd = 0;
+    } else {
+#ifdef _WIN32
+        stream->fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+        stream->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        if (stream->fd < 0) {
+            fprintf(stderr, "Failed to open file: %s\n", path);
+            free(stream);
+            return NULL;
+        }
+        stream->owns_fd = 1;
+    }
+
+    memcpy(stream->stream_header, "C8FS", 4);
+    stream->stream_header[4] = FRAMESTREAM_VERSION;
+    stream->stream_header[5] = DISPLAY_WIDTH;
+    stream->stream_header[6] = DISPLAY_HEIGHT;
+    stream->stream_header[7] = 0;
+    stream->stream_header_pending = 1;
+
+    stream->has_previous = 0;
+    stream->last_keyframe = 0;
+    stream->count = 0;
+
+    return stream;
+}
+
+void framestream_close(FrameStream** stream)
+{
+    if (*stream == NULL) {
+        return;
+    }
+
+    framestream_flush(*stream);
+    if ((*stream)->owns_fd) {
+#ifdef _WIN32
+        _close((*stream)->fd);
+#else
+        close((*stream)->fd);
+#endif
+    }
+
+    free(*stream);
+    *stream = NULL;
+}
+
+/* Stream functions */
+int framestream_push(FrameStream* stream, uint32_t frame, const uint8_t* display)
+{
+    // Consumers must not wait for a full batch, a static screen may not produce one for minutes
+    if (stream->count > 0 && frame - stream->pending_frame >= FRAMESTREAM_FLUSH_INTERVAL && framestream_flush(stream) != 0) {
+        return 1;
+    }
+
+    int keyframe = !stream->has_previous || frame - stream->last_keyframe >= FRAMESTREAM_KEYFRAME_INTERVAL;
+    if (!keyframe && memcmp(stream->previous, display, SIZE_DISPLAY) == 0) {
+        return 0; // Duplicate frame
+    }
+
+    if (stream->count == FRAMESTREAM_BATCH && framestream_flush(stream) != 0) {
+        return 1;
+    }
+
+    if (stream->count == 0) {
+        stream->pending_frame = frame;
+    }
+
+    uint8_t* header = stream->headers[stream->count];
+    uint8_t* payload = stream->payloads[stream->count];
+    int length = keyframe ? -1 : encode_delta(stream->previous, display, payload);
+    if (length < 0) {
+        memcpy(payload, display, SIZE_DISPLAY);
+        length = SIZE_DISPLAY;
+        header[4] = FRAME_RAW;
+        stream->last_keyframe = frame;
+    } else {
+        header[4] = FRAME_DELTA;
+    }
+
+    header[0] = frame & 0xFF;
+    header[1] = (frame >> 8) & 0xFF;
+    header[2] = (frame >> 16) & 0xFF;
+    header[3] = (frame >> 24) & 0xFF;
+    header[5] = length & 0xFF;
+    header[6] = (length >> 8) & 0xFF;
+    stream->lengths[stream->count] = length;
+    stream->count++;
+
+    memcpy(stream->previous, display, SIZE_DISPLAY);
+    stream->has_previous = 1;
+
+    return 0;
+}
+
+int framestream_flush(FrameStream* stream)
+{
+    int iovcnt = 0;
+    if (stream->stream_header_pending) {
+        stream->iov[iovcnt].iov_base = stream->stream_header;
+        stream->iov[iovcnt].iov_len = STREAM_HEADER_SIZE;
+        iovcnt++;
+    }
+
+    for (int i = 0; i < stream->count; i++) {
+        stream->iov[iovcnt].iov_base = stream->headers[i];
+        stream->iov[iovcnt].iov_len = FRAME_HEADER_SIZE;
+        iovcnt++;
+        stream->iov[iovcnt].iov_base = stream->payloads[i];
+        stream->iov[iovcnt].iov_len = stream->lengths[i];
+        iovcnt++;
+    }
+
+    if (iovcnt == 0) {
+        return 0;
+    }
+
+    stream->stream_header_pending = 0;
+    stream->count = 0;
+    if (write_all(stream->fd, stream->iov, iovcnt) != 0) {
+        fprintf(stderr, "Failed to write frame stream: %s\n", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Alys Elica
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FRAMESTREAM_H
+#define FRAMESTREAM_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+/*
+ * Raw framebuffer stream
+ *
+ * Stream header (8 bytes):
+ *     "C8FS", version, display width, display height, reserved
+ *
+ * Frame record (7 bytes + payload):
+ *     frame counter (uint32 LE), type (uint8), payload length (uint16 LE)
+ *
+ * FRAME_RAW payload is the SIZE_DISPLAY bytes display bitmap.
+ * FRAME_DELTA payload is the display XORed with the previous frame, RLE encoded
+ * as a sequence of (skip, count, count bytes) where skip is the number of
+ * unchanged bytes before the next count changed bytes.
+ *
+ * Frames identical to the previous one are not written, consumers should use
+ * the frame counter to detect them.
+ */
+
+#define FRAMESTREAM_VERSION 1
+#define FRAMESTREAM_KEYFRAME_INTERVAL (UPS * 10) // Force a FRAME_RAW record every 10 seconds
+#define FRAMESTREAM_BATCH 64                      // Number of records buffered before being written
+#define FRAMESTREAM_FLUSH_INTERVAL UPS            // Frames a record can stay buffered before being written
+
+typedef enum {
+    FRAME_RAW = 0,
+    FRAME_DELTA = 1,
+} FrameType;
+
+typedef struct FrameStream FrameStream;
+
+/* Basic functions */
+FrameStream* framestream_open(const char* path);
+void framestream_close(FrameStream** stream);
+
+/* Stream functions */
+int framestream_push(FrameStream* stream, uint32_t frame, const uint8_t* display);
+int framestream_flush(FrameStream* stream);
+
+#endif // FRAMESTREAM_H
@@ -0,0 +1,620 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Alys Elica
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Differential fuzzer
+ *
+ * Random and mutated programs are run from identical start states through the
+ * reference interpreter and every engine listed in ENGINES, the full Chip8 state
+ * is compared after every block. Failing programs are shrunk to a minimal
+ * reproducer before being reported.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+#define FUZZ_CODE_BEG 0x0200
+#define FUZZ_MAX_INSTRUCTIONS 64
+#define FUZZ_BLOCK_SIZE 16 // Instructions per block
+#define FUZZ_BLOCKS 32     // Blocks per run
+#define FUZZ_CORPUS 64     // Programs kept per thread for mutation
+#define FUZZ_MAX_THREADS 64
+#define FUZZ_MAX_ENGINES 8
+
+typedef struct {
+    const char* name;
+    void (*run)(Chip8* chip8, int count); // Execute exactly count instructions, stopping early on halt only
+} FuzzEngine;
+
+typedef struct {
+    uint16_t program[FUZZ_MAX_INSTRUCTIONS];
+    int length;
+
+    uint8_t v[SIZE_V];
+    uint16_t i;
+    uint16_t keys;
+    uint32_t rng;
+} FuzzInput;
+
+typedef struct {
+    uint64_t seed;
+    Chip8* blank; // Freshly created state, never executed
+    Chip8* reference;
+    Chip8* engines[FUZZ_MAX_ENGINES]; // One instance per engine, so that engines can keep their own settings
+    FuzzInput corpus[FUZZ_CORPUS];
+} FuzzThread;
+
+void run_reference(Chip8* chip8, int count)
+{
+    for (int i = 0; i < count && chip8->halt_code == HLT_NONE; i++) {
+        chip8_next_instruction(chip8);
+    }
+}
+
+// Instrumented path, resumed after each breakpoint or watchpoint hit
+void run_resuming(Chip8* chip8, int count)
+{
+    for (int i = 0; i < count && chip8->halt_code == HLT_NONE;) {
+        chip8_next_instruction(chip8);
+        if (chip8->halt_code == HLT_BREAKPOINT || chip8->halt_code == HLT_WATCHPOINT) {
+            chip8_resume(chip8);
+        } else {
+            i++;
+        }
+    }
+}
+
+void set_all_breakpoints(Chip8* chip8)
+{
+    for (int address = 0; address < SIZE_MEMORY; address++) {
+        if (chip8_set_breakpoint(chip8, address) != 0) {
+            printf("Failed to set breakpoints\n");
+            exit(1);
+        }
+    }
+}
+
+void set_all_watchpoints(Chip8* chip8)
+{
+    if (chip8_set_watchpoint(chip8, 0, SIZE_MEMORY, WATCH_READ | WATCH_WRITE) != 0) {
+        printf("Failed to set watchpoints\n");
+        exit(1);
+    }
+}
+
+// Breakpoints and watchpoints are set once per instance, load_input keeps them
+void run_breakpoints(Chip8* chip8, int count)
+{
+    if (chip8->debug == NULL) {
+        set_all_breakpoints(chip8);
+    }
+
+    run_resuming(chip8, count);
+}
+
+void run_watchpoints(Chip8* chip8, int count)
+{
+    if (chip8->debug == NULL) {
+        set_all_watchpoints(chip8);
+    }
+
+    run_resuming(chip8, count);
+}
+
+void run_debug(Chip8* chip8, int count)
+{
+    if (chip8->debug == NULL) {
+        set_all_breakpoints(chip8);
+        set_all_watchpoints(chip8);
+    }
+
+    run_resuming(chip8, count);
+}
+
+// Alternative engines to compare against the reference
+const FuzzEngine ENGINES[] = {
+    { "reference", run_reference },
+    { "breakpoints", run_breakpoints },
+    { "watchpoints", run_watchpoints },
+    { "debug", run_debug },
+};
+#define ENGINE_COUNT (int)(sizeof(ENGINES) / sizeof(ENGINES[0]))
+_Static_assert(ENGINE_COUNT <= FUZZ_MAX_ENGINES, "Too many engines, increase FUZZ_MAX_ENGINES");
+
+atomic_ullong total_execs = 0;
+atomic_int failed = 0; // Number of mismatches found
+atomic_int stop = 0;
+pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Random generator */
+uint64_t next_u64(uint64_t* state)
+{
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+uint32_t next_below(uint64_t* state, uint32_t bound)
+{
+    return (uint32_t)(next_u64(state) % bound);
+}
+
+/* Input generation */
+uint16_t random_instruction(uint64_t* state, int length)
+{
+    uint16_t opcode = (uint16_t)next_u64(state);
+    switch (opcode & 0xF000) {
+    case 0x1000:
+    case 0x2000:
+    case 0xB000: // Keep most jumps inside the program
+        if (next_below(state, 4) != 0) {
+            return (opcode & 0xF000) | (FUZZ_CODE_BEG + 2 * next_below(state, length));
+        }
+        return opcode;
+    default:
+        return opcode;
+    }
+}
+
+void random_input(uint64_t* state, FuzzInput* input)
+{
+    input->length = 1 + next_below(state, FUZZ_MAX_INSTRUCTIONS);
+    for (int i = 0; i < input->length; i++) {
+        input->program[i] = random_instruction(state, input->length);
+    }
+
+    for (int i = 0; i < SIZE_V; i++) {
+        input->v[i] = (uint8_t)next_u64(state);
+    }
+    input->i = next_below(state, SIZE_MEMORY);
+    input->keys = (uint16_t)next_u64(state);
+    input->rng = (uint32_t)next_u64(state) | 1;
+}
+
+void mutate_input(uint64_t* state, FuzzInput* input)
+{
+    int mutations = 1 + next_below(state, 4);
+    for (int m = 0; m < mutations; m++) {
+        int index = next_below(state, input->length);
+        switch (next_below(state, 6)) {
+        case 0: // Flip a bit
+            input->program[index] ^= 1 << next_below(state, 16);
+            break;
+        case 1: // Replace an instruction
+            input->program[index] = random_instruction(state, input->length);
+            break;
+        case 2: { // Swap two instructions
+            int other = next_below(state, input->length);
+            uint16_t tmp = input->program[index];
+            input->program[index] = input->program[other];
+            input->program[other] = tmp;
+        } break;
+        case 3: // Insert an instruction
+            if (input->length < FUZZ_MAX_INSTRUCTIONS) {
+                memmove(&input->program[index + 1], &input->program[index], (input->length - index) * sizeof(uint16_t));
+                input->program[index] = random_instruction(state, input->length + 1);
+                input->length++;
+            }
+            break;
+        case 4: // Remove an instruction
+            if (input->length > 1) {
+                memmove(&input->program[index], &input->program[index + 1], (input->length - index - 1) * sizeof(uint16_t));
+                input->length--;
+            }
+            break;
+        case 5: // Change the start state
+            input->v[next_below(state, SIZE_V)] = (uint8_t)next_u64(state);
+            input->i = next_below(state, SIZE_MEMORY);
+            input->keys = (uint16_t)next_u64(state);
+            break;
+        }
+    }
+}
+
+/* Execution */
+void load_input(Chip8* chip8, const Chip8* blank, const FuzzInput* input)
+{
+    // Breakpoints and watchpoints are not part of the state
+    Chip8Debug* debug = chip8->debug;
+    *chip8 = *blank;
+    chip8->debug = debug;
+    for (int i = 0; i < input->length; i++) {
+        chip8->memory[FUZZ_CODE_BEG + 2 * i] = input->program[i] >> 8;
+        chip8->memory[FUZZ_CODE_BEG + 2 * i + 1] = input->program[i] & 0xFF;
+    }
+    memcpy(chip8->v, input->v, SIZE_V);
+    chip8->i = input->i;
+    chip8->keys = input->keys;
+    chip8->rng = input->rng;
+}
+
+// Whether the next instruction has defined behavior, the interpreter does not bound check memory accesses
+int next_instruction_defined(const Chip8* chip8)
+{
+    if (chip8->pc > SIZE_MEMORY - 2) {
+        return 0;
+    }
+
+    uint16_t opcode = chip8->memory[chip8->pc] << 8 | chip8->memory[chip8->pc + 1];
+    uint8_t x = (opcode & 0x0F00) >> 8;
+    switch (opcode & 0xF000) {
+    case 0xD000:
+        return chip8->i + (opcode & 0x000F) <= SIZE_MEMORY;
+    case 0xE000:
+        return chip8->v[x] < 32;
+    case 0xF000:
+        switch (opcode & 0x00FF) {
+        case 0x33:
+            return chip8->i + 3 <= SIZE_MEMORY;
+        case 0x55:
+        case 0x65:
+            return chip8->i + x + 1 <= SIZE_MEMORY;
+        }
+        return 1;
+    default:
+        return 1;
+    }
+}
+
+// Returns the name of the first differing field, NULL if both states are identical
+const char* state_diff(const Chip8* a, const Chip8* b)
+{
+    if (memcmp(a->memory, b->memory, SIZE_MEMORY) != 0) {
+        return "memory";
+    }
+    if (memcmp(a->display, b->display, SIZE_DISPLAY) != 0) {
+        return "display";
+    }
+    if (memcmp(a->stack, b->stack, sizeof(a->stack)) != 0) {
+        return "stack";
+    }
+    if (memcmp(a->v, b->v, SIZE_V) != 0) {
+        return "v";
+    }
+    if (a->i != b->i) {
+        return "i";
+    }
+    if (a->pc != b->pc) {
+        return "pc";
+    }
+    if (a->sp != b->sp) {
+        return "sp";
+    }
+    if (a->timer_delay != b->timer_delay || a->timer_sound != b->timer_sound) {
+        return "timers";
+    }
+    if (a->keys != b->keys) {
+        return "keys";
+    }
+    if (a->halt_code != b->halt_code) {
+        return "halt_code";
+    }
+    if (a->vblank != b->vblank) {
+        return "vblank";
+    }
+    if (a->rng != b->rng) {
+        return "rng";
+    }
+    if (a->frame != b->frame) {
+        return "frame";
+    }
+    if (a->event_head != b->event_head || a->event_tail != b->event_tail || a->events_dropped != b->events_dropped) {
+        return "events";
+    }
+    if (memcmp(a->event_counts, b->event_counts, sizeof(a->event_counts)) != 0) {
+        return "event_counts";
+    }
+    for (uint32_t i = a->event_head; i != a->event_tail; i++) {
+        const Chip8Event* ea = &a->events[i % SIZE_EVENTS];
+        const Chip8Event* eb = &b->events[i % SIZE_EVENTS];
+        if (ea->code != eb->code || ea->pc != eb->pc || ea->opcode != eb->opcode || ea->frame != eb->frame || ea->repeat != eb->repeat) {
+            return "events";
+        }
+    }
+
+    return NULL;
+}
+
+// Runs input through the reference and the engine, returns the first differing field or NULL
+const char* check_input(FuzzThread* thread, const FuzzEngine* engine, const FuzzInput* input, int* failed_block)
+{
+    Chip8* reference = thread->reference;
+    Chip8* other = thread->engines[engine - ENGINES];
+
+    load_input(reference, thread->blank, input);
+    load_input(other, thread->blank, input);
+
+    for (int block = 0; block < FUZZ_BLOCKS; block++) {
+        // Step the reference until the end of the block or the first undefined instruction
+        int count = 0;
+        while (count < FUZZ_BLOCK_SIZE && reference->halt_code == HLT_NONE && next_instruction_defined(reference)) {
+            chip8_next_instruction(reference);
+            count++;
+        }
+
+        engine->run(other, count);
+
+        const char* diff = state_diff(reference, other);
+        if (diff != NULL) {
+            *failed_block = block;
+            return diff;
+        }
+
+        if (count < FUZZ_BLOCK_SIZE || reference->halt_code != HLT_NONE) {
+            break;
+        }
+
+        // Drain events once per frame like a frontend, events are already compared by state_diff
+        Chip8Event event;
+        while (chip8_poll_event(reference, &event)) {
+        }
+        while (chip8_poll_event(other, &event)) {
+        }
+        chip8_take_dropped_events(reference);
+        chip8_take_dropped_events(other);
+
+        chip8_vblank(reference);
+        chip8_vblank(other);
+    }
+
+    return NULL;
+}
+
+/* Shrinking */
+void shrink_input(FuzzThread* thread, const FuzzEngine* engine, FuzzInput* input)
+{
+    int block;
+    FuzzInput candidate;
+
+    // Remove chunks of instructions, halving the chunk size when nothing can be removed
+    for (int chunk = input->length / 2; chunk >= 1; chunk /= 2) {
+        for (int start = 0; start + chunk <= input->length && input->length > chunk;) {
+            candidate = *input;
+            memmove(&candidate.program[start], &candidate.program[start + chunk], (candidate.length - start - chunk) * sizeof(uint16_t));
+            candidate.length -= chunk;
+            if (check_input(thread, engine, &candidate, &block) != NULL) {
+                *input = candidate;
+            } else {
+                start += chunk;
+            }
+        }
+    }
+
+    // Simplify the start state
+    for (int i = 0; i < SIZE_V; i++) {
+        candidate = *input;
+        candidate.v[i] = 0;
+        if (check_input(thread, engine, &candidate, &block) != NULL) {
+            *input = candidate;
+        }
+    }
+
+    candidate = *input;
+    candidate.i = 0;
+    if (check_input(thread, engine, &candidate, &block) != NULL) {
+        *input = candidate;
+    }
+
+    candidate = *input;
+    candidate.keys = 0;
+    if (check_input(thread, engine, &candidate, &block) != NULL) {
+        *input = candidate;
+    }
+}
+
+void report_failure(FuzzThread* thread, const FuzzEngine* engine, FuzzInput* input)
+{
+    atomic_store(&stop, 1);
+
+    pthread_mutex_lock(&report_mutex);
+    if (atomic_fetch_add(&failed, 1) != 0) {
+        pthread_mutex_unlock(&report_mutex);
+        return; // Only report the first failure
+    }
+
+    printf("Engine '%s' differs from reference, shrinking...\n", engine->name);
+    shrink_input(thread, engine, input);
+
+    int block = 0;
+    const char* diff = check_input(thread, engine, input, &block);
+    printf("Mismatch on '%s' after block %d\n", diff != NULL ? diff : "?", block);
+    printf("    Program (%d instructions at %04X):\n        ", input->length, FUZZ_CODE_BEG);
+    for (int i = 0; i < input->length; i++) {
+        printf("%04X ", input->program[i]);
+    }
+    printf("\n");
+    printf("    I: %04X\n", input->i);
+    printf("    Keys: %04X\n", input->keys);
+    printf("    RNG: %08X\n", input->rng);
+    printf("    V registers:\n        ");
+    for (int i = 0; i < SIZE_V; i++) {
+        printf("%02X ", input->v[i]);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    pthread_mutex_unlock(&report_mutex);
+}
+
+void* fuzz_thread(void* arg)
+{
+    FuzzThread* thread = arg;
+    uint64_t state = thread->seed;
+
+    for (int i = 0; i < FUZZ_CORPUS; i++) {
+        random_input(&state, &thread->corpus[i]);
+    }
+
+    FuzzInput input;
+    unsigned long long execs = 0;
+    int mismatch = 0;
+    while (!mismatch && atomic_load(&stop) == 0) {
+        // Either mutate a corpus entry or generate a new one
+        int slot = next_below(&state, FUZZ_CORPUS);
+        if (next_below(&state, 2) == 0) {
+            input = thread->corpus[slot];
+            mutate_input(&state, &input);
+        } else {
+            random_input(&state, &input);
+        }
+        thread->corpus[slot] = input;
+
+        for (int e = 0; e < ENGINE_COUNT && !mismatch; e++) {
+            int block;
+            if (check_input(thread, &ENGINES[e], &input, &block) != NULL) {
+                report_failure(thread, &ENGINES[e], &input);
+                mismatch = 1;
+            }
+        }
+
+        if (++execs == 1024) {
+            atomic_fetch_add(&total_execs, execs);
+            execs = 0;
+        }
+    }
+
+    atomic_fetch_add(&total_execs, execs);
+
+    return NULL;
+}
+
+void print_usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "    -threads <count>   Number of threads (default: number of CPUs)\n");
+    fprintf(stderr, "    -time <seconds>    Stop after <seconds> (default: run until a failure)\n");
+    fprintf(stderr, "    -seed <seed>       Random seed (default: current time)\n");
+}
+
+int main(int argc, char* argv[])
+{
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    long duration = -1;
+    uint64_t seed = (uint64_t)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = strtol(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
+            duration = strtol(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (thread_count < 1) {
+        thread_count = 1;
+    } else if (thread_count > FUZZ_MAX_THREADS) {
+        thread_count = FUZZ_MAX_THREADS;
+    }
+
+    printf("Fuzzing %d engine(s) with %ld thread(s), seed %llu\n", ENGINE_COUNT, thread_count, (unsigned long long)seed);
+
+    FuzzThread* threads = calloc(thread_count, sizeof(FuzzThread));
+    pthread_t* handles = calloc(thread_count, sizeof(pthread_t));
+    if (threads == NULL || handles == NULL) {
+        printf("Failed to allocate threads\n");
+        free(handles);
+        free(threads);
+        return 1;
+    }
+
+    int result = 0;
+    long started = 0;
+    for (; started < thread_count; started++) {
+        FuzzThread* thread = &threads[started];
+        thread->seed = seed + started * 0x9E3779B97F4A7C15ULL;
+        thread->blank = chip8_new();
+        thread->reference = chip8_new();
+        int created = thread->blank != NULL && thread->reference != NULL;
+        for (int e = 0; e < ENGINE_COUNT; e++) {
+            thread->engines[e] = chip8_new();
+            created = created && thread->engines[e] != NULL;
+        }
+        if (!created) {
+            printf("Failed to create Chip8\n");
+            result = 1;
+            break;
+        }
+
+        if (pthread_create(&handles[started], NULL, fuzz_thread, thread) != 0) {
+            printf("Failed to start thread\n");
+            result = 1;
+            break;
+        }
+    }
+
+    // Report progress every second
+    time_t start = time(NULL);
+    unsigned long long last_execs = 0;
+    while (result == 0 && atomic_load(&stop) == 0) {
+        sleep(1);
+
+        long elapsed = (long)(time(NULL) - start);
+        unsigned long long execs = atomic_load(&total_execs);
+        printf("[%lds] execs: %llu (%llu/s)\n", elapsed, execs, execs - last_execs);
+        fflush(stdout);
+        last_execs = execs;
+
+        if (duration >= 0 && elapsed >= duration) {
+            break;
+        }
+    }
+
+    atomic_store(&stop, 1);
+
+    for (long t = 0; t < started; t++) {
+        pthread_join(handles[t], NULL);
+    }
+
+    for (long t = 0; t < thread_count; t++) {
+        chip8_free(&threads[t].blank);
+        chip8_free(&threads[t].reference);
+        for (int e = 0; e < ENGINE_COUNT; e++) {
+            chip8_free(&threads[t].engines[e]);
+        }
+    }
+
+    free(handles);
+    free(threads);
+
+    if (result == 0) {
+        long elapsed = (long)(time(NULL) - start);
+        unsigned long long execs = atomic_load(&total_execs);
+        printf("Done: %llu execs in %lds (%llu/s)\n", execs, elapsed, execs / (elapsed > 0 ? elapsed : 1));
+    }
+
+    return result != 0 || atomic_load(&failed) > 0 ? 1 : 0;
+}
@@ -23,16 +23,21 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include <SDL.h>
 
 #include "chip8.h"
+#include "framestream.h"
 
 #define SCREEN_SCALE 10
 #define SCREEN_WIDTH 64 * SCREEN_SCALE
 #define SCREEN_HEIGHT 32 * SCREEN_SCALE
 
+#define HEADLESS_INSTRUCTIONS_PER_FRAME 12 // About 700 instructions per second
+
 uint8_t sdl_key_to_chip8(SDL_Keycode key)
 {
     switch (key) {
@@ -83,18 +88,76 @@ uint8_t sdl_key_to_chip8(SDL_Keycode key)
     }
 }
 
-int main(int argc, char* argv[])
+void print_events(Chip8* chip8)
 {
-    srand(time(NULL));
+    Chip8Event event;
+    while (chip8_poll_event(chip8, &event)) {
+        fprintf(stderr, "[%u] %04X: %s (0x%04X)", event.frame, event.pc, chip8_event_name(event.code), event.opcode);
+        if (event.repeat > 0) {
+            fprintf(stderr, " repeated %u times", event.repeat);
+        }
+        fprintf(stderr, "\n");
+    }
 
-    // Check arguments
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <rom>\n", argv[0]);
-        return 1;
+    uint32_t dropped = chip8_take_dropped_events(chip8);
+    if (dropped > 0) {
+        fprintf(stderr, "%u events dropped\n", dropped);
+    }
+}
+
+void print_halt(Chip8* chip8)
+{
+    if (chip8->halt_code == HLT_BREAKPOINT && chip8->debug != NULL) {
+        fprintf(stderr, "Breakpoint at %04X\n", chip8->debug->hit_address);
+    } else if (chip8->halt_code == HLT_WATCHPOINT && chip8->debug != NULL) {
+        fprintf(stderr, "Watchpoint (%s) at %04X\n", chip8->debug->hit_mode == WATCH_READ ? "read" : "write", chip8->debug->hit_address);
+    } else {
+        fprintf(stderr, "Halted [%d]\n", chip8->halt_code);
+    }
+    fprintf(stderr, "    PC: %04X\n", chip8->pc);
+    fprintf(stderr, "    SP: %02X\n", chip8->sp);
+    fprintf(stderr, "    I: %04X\n", chip8->i);
+
+    fprintf(stderr, "    V registers:\n        ");
+    for (int i = 0; i < SIZE_V; i++) {
+        fprintf(stderr, "%02X ", chip8->v[i]);
+    }
+    fprintf(stderr, "\n");
+
+    fprintf(stderr, "    Current instruction: %04X\n", chip8_current_instruction(chip8));
+}
+
+int run_headless(Chip8* chip8, FrameStream* stream, long frames)
+{
+    for (long frame = 0; frames < 0 || frame < frames; frame++) {
+        for (int i = 0; i < HEADLESS_INSTRUCTIONS_PER_FRAME; i++) {
+            chip8_next_instruction(chip8);
+            if (chip8->halt_code == HLT_BREAKPOINT || chip8->halt_code == HLT_WATCHPOINT) {
+                print_halt(chip8);
+                chip8_resume(chip8);
+            }
+            if (chip8->halt_code != HLT_NONE) {
+                print_events(chip8);
+                print_halt(chip8);
+                return stream != NULL ? framestream_flush(stream) : 0;
+            }
+        }
+
+        chip8_vblank(chip8);
+        print_events(chip8);
+
+        if (stream != NULL && framestream_push(stream, chip8->frame, chip8->display) != 0) {
+            return 1;
+        }
     }
 
+    return 0;
+}
+
+int run_sdl(Chip8* chip8, FrameStream* stream, FILE* log)
+{
     // Init SDL
-    printf("Init SDL\n");
+    fprintf(log, "Init SDL\n");
 
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
@@ -116,33 +179,12 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    // Init Chip8 interpreter
-    printf("Init Chip8 interpreter\n");
-
-    const char* rom = argv[1];
-    Chip8* chip8 = chip8_new();
-    if (chip8 == NULL) {
-        fprintf(stderr, "Failed to create Chip8\n");
-        SDL_DestroyWindow(window);
-        SDL_Quit();
-        return 1;
-    }
-
-    if (chip8_load(chip8, rom) != 0) {
-        fprintf(stderr, "Failed to load ROM\n");
-        chip8_free(&chip8);
-        SDL_DestroyWindow(window);
-        SDL_Quit();
-        return 1;
-    }
-
-    printf("Loaded %s\n", rom);
-
     // Main loop
-    printf("Starting Chip8 program\n");
+    fprintf(log, "Starting Chip8 program\n");
 
     SDL_Event e;
     int quit = 0;
+    int result = 0;
     clock_t last_time = clock();
     while (!quit) {
         // Poll events
@@ -174,20 +216,18 @@ int main(int argc, char* argv[])
 
         // SDL_Delay(1);
 
+        if (chip8->halt_code == HLT_BREAKPOINT || chip8->halt_code == HLT_WATCHPOINT) {
+            print_halt(chip8);
+            chip8_resume(chip8);
+        }
+
         if (chip8->halt_code != HLT_NONE) {
             SDL_SetWindowTitle(window, "[HALTED]");
-            fprintf(stderr, "Halted [%d]\n", chip8->halt_code);
-            fprintf(stderr, "    PC: %04X\n", chip8->pc);
-            fprintf(stderr, "    SP: %02X\n", chip8->sp);
-            fprintf(stderr, "    I: %04X\n", chip8->i);
-
-            fprintf(stderr, "    V registers:\n        ");
-            for (int i = 0; i < SIZE_V; i++) {
-                fprintf(stderr, "%02X ", chip8->v[i]);
+            print_events(chip8);
+            print_halt(chip8);
+            if (stream != NULL) {
+                result = framestream_flush(stream);
             }
-            fprintf(stderr, "\n");
-
-            fprintf(stderr, "    Current instruction: %04X\n", chip8_current_instruction(chip8));
             break;
         }
 
@@ -198,6 +238,12 @@ int main(int argc, char* argv[])
             last_time = current_time;
 
             chip8_vblank(chip8);
+            print_events(chip8);
+
+            if (stream != NULL && framestream_push(stream, chip8->frame, chip8->display) != 0) {
+                result = 1;
+                break;
+            }
 
             // Render
             SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
@@ -216,13 +262,141 @@ int main(int argc, char* argv[])
         }
     }
 
-    // Cleanup
-    printf("Cleanup\n");
-
-    chip8_free(&chip8);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
-    return 0;
+    return result;
+}
+
+void print_usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [options] <rom>\n", program);
+    fprintf(stderr, "    -headless        Run without window\n");
+    fprintf(stderr, "    -frames <count>  Stop after <count> frames (headless only)\n");
+    fprintf(stderr, "    -stream <path>   Stream frames to <path> ('-' for stdout)\n");
+    fprintf(stderr, "    -break <address> Print state before executing the instruction at <address>\n");
+    fprintf(stderr, "    -watch <address>[:<size>]\n");
+    fprintf(stderr, "                     Print state before instructions reading or writing memory at <address>\n");
+}
+
+int set_debug_option(Chip8* chip8, const char* option, const char* value)
+{
+    char* end = NULL;
+    long address = strtol(value, &end, 0);
+    if (end == value || address < 0 || address >= SIZE_MEMORY) {
+        return 1;
+    }
+
+    if (strcmp(option, "-break") == 0) {
+        return *end != '\0' || chip8_set_breakpoint(chip8, address) != 0;
+    }
+
+    long size = 1;
+    if (*end == ':') {
+        const char* size_value = end + 1;
+        size = strtol(size_value, &end, 0);
+        if (end == size_value) {
+            return 1;
+        }
+    }
+    if (*end != '\0' || size < 1 || address + size > SIZE_MEMORY) {
+        return 1;
+    }
+
+    return chip8_set_watchpoint(chip8, address, size, WATCH_READ | WATCH_WRITE) != 0;
+}
+
+int main(int argc, char* argv[])
+{
+    srand(time(NULL));
+
+    // Check arguments
+    const char* rom = NULL;
+    const char* stream_path = NULL;
+    int headless = 0;
+    long frames = -1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-headless") == 0) {
+            headless = 1;
+        } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            const char* value = argv[++i];
+            char* end = NULL;
+            frames = strtol(value, &end, 0);
+            if (end == value || *end != '\0' || frames < 0) {
+                fprintf(stderr, "Invalid -frames count: %s\n", value);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-stream") == 0 && i + 1 < argc) {
+            stream_path = argv[++i];
+        } else if ((strcmp(argv[i], "-break") == 0 || strcmp(argv[i], "-watch") == 0) && i + 1 < argc) {
+            i++; // Applied once the ROM is loaded
+        } else if (argv[i][0] != '-' && rom == NULL) {
+            rom = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (rom == NULL) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (frames >= 0 && !headless) {
+        fprintf(stderr, "-frames is only supported with -headless\n");
+        return 1;
+    }
+
+    // Status messages go to stderr when frames are streamed to stdout
+    FILE* log = (stream_path != NULL && strcmp(stream_path, "-") == 0) ? stderr : stdout;
+
+    // Init Chip8 interpreter
+    fprintf(log, "Init Chip8 interpreter\n");
+
+    Chip8* chip8 = chip8_new();
+    if (chip8 == NULL) {
+        fprintf(stderr, "Failed to create Chip8\n");
+        return 1;
+    }
+
+    if (chip8_load(chip8, rom) != 0) {
+        fprintf(stderr, "Failed to load ROM\n");
+        chip8_free(&chip8);
+        return 1;
+    }
+
+    fprintf(log, "Loaded %s\n", rom);
+
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-break") == 0 || strcmp(argv[i], "-watch") == 0) {
+            if (set_debug_option(chip8, argv[i], argv[i + 1]) != 0) {
+                fprintf(stderr, "Invalid %s address: %s\n", argv[i], argv[i + 1]);
+                chip8_free(&chip8);
+                return 1;
+            }
+            i++;
+        }
+    }
+
+    FrameStream* stream = NULL;
+    if (stream_path != NULL) {
+        stream = framestream_open(stream_path);
+        if (stream == NULL) {
+            fprintf(stderr, "Failed to open frame stream\n");
+            chip8_free(&chip8);
+            return 1;
+        }
+    }
+
+    int result = headless ? run_headless(chip8, stream, frames) : run_sdl(chip8, stream, log);
+
+    // Cleanup
+    fprintf(log, "Cleanup\n");
+
+    framestream_close(&stream);
+    chip8_free(&chip8);
+
+    return result;
 }